@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <math.h>
 
 
 #include "system.h"
@@ -34,12 +35,41 @@
 #define   TASK_STACKSIZE       2048
 
 // Definition of Task Priorities
-#define LEDcontroller_priority 3
+// Rate monotonic: shorter periods get higher priorities, and the shedding path
+// (stabilityCheck -> fsmControl -> actuator) always outranks presentation.
+// Tasks with equal priority are round robin scheduled.
+#define actuator_task_P		   4
+#define stabilityCheck_task_P	   3
+#define fsmControl_task_P	   3
 #define switchPolling_priority 2
-#define PRVGADraw_Task_P      4
+#define plantSim_task_P		   2
 #define keyboard_task_P		  2
-#define fsmControl_task_P	   1
-#define stabilityCheck_task_P	   1
+#define PRVGADraw_Task_P      1
+
+// Definition of Task Periods and Deadlines (ms)
+// Event driven tasks use their minimum inter-arrival time as the period
+#define plantSim_task_T		   10
+#define plantSim_task_D		   10
+// The actuator is sporadic and has no minimum inter-arrival time: fsmControl
+// (5 ms), switchPolling (10 ms) and the button ISR can each release it within
+// the same period. Its T is the fastest periodic source, reported for
+// reference only and not a bound. Coalescing limits it to one job per burst.
+#define actuator_task_T		   fsmControl_task_T
+#define actuator_task_D		   2   // From the load change to the LED write
+#define stabilityCheck_task_T	   5
+#define stabilityCheck_task_D	   5
+#define fsmControl_task_T	   5
+#define fsmControl_task_D	   5
+#define switchPolling_T		   10
+#define switchPolling_D		   10
+#define keyboard_task_T		   50
+#define keyboard_task_D		   50
+#define PRVGADraw_MIN_T		   5   // VGA frame period adapts between these
+#define PRVGADraw_MAX_T		   200
+#define TIMING_REPORT_PERIOD   5000 // ms between deadline reports on the console
+
+// Uncomment to drive the relay from the simulated power system instead of the frequency analyser
+//#define PLANT_SIM
 
 
 // Definition of Queues
@@ -62,6 +92,7 @@ bool stable = true;			// Stability bool
 bool timerFinished = false; // Flag for 500ms timer finish
 bool timing = true;			// Flag for timing reaction time
 bool allConnected = false;  // Flag for if relay has reonnected all loads
+volatile bool historyReset = false; // Asks stabilityCheck_task to restart its frequency history
 
 bool load_status[5];		// Load array controlled by relay
 bool switch_status[5];		// Switch array controlled only by switches
@@ -82,6 +113,11 @@ typedef struct{
 	unsigned int y2;
 }Line;
 
+typedef struct{
+	unsigned char key;
+	TickType_t pressed;		// Tick the key arrived in the ISR
+}KeyPress;
+
 // Timer and task handles
 TimerHandle_t timer500;
 TaskHandle_t Timer_Reset;
@@ -95,6 +131,7 @@ xSemaphoreHandle loadStatusSemaphore;
 xSemaphoreHandle systemStatusSemaphore;
 xSemaphoreHandle measurementSemaphore;
 xSemaphoreHandle stableSemaphore;
+xSemaphoreHandle actuateSemaphore;
 
 
 //For frequency plot
@@ -109,6 +146,7 @@ xSemaphoreHandle stableSemaphore;
 #define ROCPLT_ROC_RES 0.5		//number of pixels per Hz/s (y axis scale)
 
 #define MIN_FREQ 45.0 			//minimum frequency to draw
+#define NOMINAL_FREQ 50.0		//grid frequency with no disturbance
 
 
 // GLOBAL VARIABLES
@@ -130,8 +168,44 @@ unsigned volatile int button_value = 0;  // To switch between modes (0 = normal)
 unsigned int switch_value = 0;           // Value of switches
 char char_test[100];
 
+bool actuationPending = false;			  // Set by the first load change in a burst, cleared by the actuator
+unsigned volatile int actuationStart = 0; // Tick of the first uncommitted load change
+volatile int actuationLatency = 0;		  // Last decision-to-output latency, only written by the actuator
+volatile int actuationMax = 0;			  // Worst decision-to-output latency, only written by the actuator
+
 static volatile int currentFreq;
 
+typedef struct{
+	const char *name;
+	unsigned int period;	// ms
+	unsigned int deadline;	// ms, relative to the release
+	unsigned int jobs;		// Completed jobs
+	unsigned int worst;		// Worst case response time seen (ms)
+	unsigned int misses;	// Jobs that completed after their deadline
+}TaskTiming;
+
+enum{
+	PLANT_TIMING,
+	ACTUATOR_TIMING,
+	STABILITY_TIMING,
+	FSM_TIMING,
+	SWITCH_TIMING,
+	KEYBOARD_TIMING,
+	VGA_TIMING,
+	NUM_TIMINGS
+};
+
+// Each entry is only written by its own task
+TaskTiming taskTiming[NUM_TIMINGS] = {
+	{"plantSim_task", plantSim_task_T, plantSim_task_D, 0, 0, 0},
+	{"actuator_task", actuator_task_T, actuator_task_D, 0, 0, 0},
+	{"stabilityCheck_task", stabilityCheck_task_T, stabilityCheck_task_D, 0, 0, 0},
+	{"fsmControl_task", fsmControl_task_T, fsmControl_task_D, 0, 0, 0},
+	{"switchPolling_task", switchPolling_T, switchPolling_D, 0, 0, 0},
+	{"keyboard_task", keyboard_task_T, keyboard_task_D, 0, 0, 0},
+	{"DrawTsk", PRVGADraw_MIN_T, PRVGADraw_MIN_T, 0, 0, 0}
+};
+
 // Local Function Prototypes
 int initOSDataStructs(void);
 int initCreateTasks(void);
@@ -142,6 +216,34 @@ double freq[100], dfreq[100];
 int i = 99, j = 0;
 Line line_freq, line_roc;
 
+// Records the response time of a job released and finished at the given ticks and checks it against the task's deadline
+void jobCompleteAt(TaskTiming *timing, TickType_t release, TickType_t finish){
+	unsigned int response = finish - release;
+	timing->jobs++;
+	if(response > timing->worst){
+		timing->worst = response;
+	}
+	if(response > timing->deadline){
+		timing->misses++;
+	}
+}
+
+// Records a job that finishes now
+void jobComplete(TaskTiming *timing, TickType_t release){
+	jobCompleteAt(timing, release, xTaskGetTickCount());
+}
+
+// Prints the response time and deadline misses of every task that has run
+void timingReport(){
+	int t;
+	printf("Task                 T(ms) D(ms)  jobs  WCRT(ms) misses\n");
+	for(t = 0; t < NUM_TIMINGS; t++){
+		if(taskTiming[t].jobs != 0){
+			printf("%-20s %5u %5u %6u %8u %6u\n", taskTiming[t].name, taskTiming[t].period,
+					taskTiming[t].deadline, taskTiming[t].jobs, taskTiming[t].worst, taskTiming[t].misses);
+		}
+	}
+}
 
 void PRVGADraw_Task(void *pvParameters ){
 
@@ -200,7 +302,14 @@ void PRVGADraw_Task(void *pvParameters ){
 	alt_up_char_buffer_string(char_buf, "Threshold Values:", 30, 54);
 	alt_up_char_buffer_string(char_buf, "Freq: ", 25, 56);
 	alt_up_char_buffer_string(char_buf, "RoC: ", 50, 56);
+	alt_up_char_buffer_string(char_buf, "Actuation latency (ms):", 12, 58);
+	alt_up_char_buffer_string(char_buf, "Max:", 45, 58);
+	alt_up_char_buffer_string(char_buf, "Shedding deadline misses:", 10, 59);
+	alt_up_char_buffer_string(char_buf, "Frame (ms):", 45, 59);
 
+	unsigned int framePeriod = PRVGADraw_MIN_T;
+	TickType_t release = xTaskGetTickCount();
+	TickType_t lastReport = release;
 
 	while(1){
 
@@ -305,12 +414,50 @@ void PRVGADraw_Task(void *pvParameters ){
 		alt_up_char_buffer_string(char_buf, char_test, 50, 49);
 		sprintf(char_test,"%1d", measurements[4]);
 		alt_up_char_buffer_string(char_buf, char_test, 50, 51);
-		xSemaphoreGive(measurementSemaphore);
 
+		alt_up_char_buffer_string(char_buf, "   ", 35, 58); // actuation latency
+		alt_up_char_buffer_string(char_buf, "   ", 50, 58); // actuation max
+		sprintf(char_test,"%1d", actuationLatency);
+		alt_up_char_buffer_string(char_buf, char_test, 35, 58);
+		sprintf(char_test,"%1d", actuationMax);
+		alt_up_char_buffer_string(char_buf, char_test, 50, 58);
+		xSemaphoreGive(measurementSemaphore);
 
-		vTaskDelay(5);
+		// UPDATES DEADLINE MISSES
+		// Only the shedding path is counted, the other tasks are in the console report
+		unsigned int misses = taskTiming[STABILITY_TIMING].misses + taskTiming[FSM_TIMING].misses
+				+ taskTiming[ACTUATOR_TIMING].misses;
+		alt_up_char_buffer_string(char_buf, "     ", 36, 59);
+		alt_up_char_buffer_string(char_buf, "   ", 57, 59);
+		sprintf(char_test,"%1u", misses);
+		alt_up_char_buffer_string(char_buf, char_test, 36, 59);
+		sprintf(char_test,"%1u", framePeriod);
+		alt_up_char_buffer_string(char_buf, char_test, 57, 59);
+
+		if(xTaskGetTickCount() - lastReport >= TIMING_REPORT_PERIOD){
+			lastReport = xTaskGetTickCount();
+			timingReport();
+		}
 
+		// Frame rate follows the CPU left over by the higher priority tasks:
+		// slow down when a frame overruns, speed back up when frames finish early
+		unsigned int response = xTaskGetTickCount() - release;
+		jobComplete(&taskTiming[VGA_TIMING], release);
+		if(response > framePeriod && framePeriod < PRVGADraw_MAX_T){
+			framePeriod *= 2;
+		}else if(response < framePeriod / 4 && framePeriod > PRVGADraw_MIN_T){
+			framePeriod /= 2;
+		}
+		if(framePeriod > PRVGADraw_MAX_T){
+			framePeriod = PRVGADraw_MAX_T;
+		}
+		if(framePeriod < PRVGADraw_MIN_T){
+			framePeriod = PRVGADraw_MIN_T;
+		}
+		taskTiming[VGA_TIMING].period = framePeriod;
+		taskTiming[VGA_TIMING].deadline = framePeriod;
 
+		vTaskDelayUntil(&release, framePeriod);
 	}
 }
 
@@ -356,6 +503,34 @@ void shed_stats(){
 
 }
 
+// Marks the LED outputs as out of date, the caller wakes the actuator with
+// flushActuation once its job is done so all of its changes share one write
+// Only the first change of a burst starts the latency measurement
+void requestActuation(){
+	taskENTER_CRITICAL();
+	if(actuationPending == false){
+		actuationPending = true;
+		actuationStart = xTaskGetTickCount();
+	}
+	taskEXIT_CRITICAL();
+}
+
+// Wakes the actuator task if any change is waiting to be written
+void flushActuation(){
+	if(actuationPending == true){
+		xSemaphoreGive(actuateSemaphore);
+	}
+}
+
+// ISR version of requestActuation
+void requestActuationFromISR(){
+	if(actuationPending == false){
+		actuationPending = true;
+		actuationStart = xTaskGetTickCountFromISR();
+	}
+	xSemaphoreGiveFromISR(actuateSemaphore, pdFALSE);
+}
+
 // Sheds the highest priority load that is connected
 void loadShedding(){
 	int i;
@@ -373,6 +548,7 @@ void loadShedding(){
 		shed_stats();
 	}
 	xSemaphoreGive(loadStatusSemaphore);
+	requestActuation();
 }
 
 // Reconnects the highest priority load that had been shed
@@ -396,6 +572,7 @@ void loadReconnect(){
 		}
 	}
 	xSemaphoreGive(loadStatusSemaphore);
+	requestActuation();
 }
 
 void reset500Timer(){
@@ -405,6 +582,7 @@ void reset500Timer(){
 
 // FSM for main control logic
 void fsmControl_task(void *pvParameters){
+	TickType_t release = xTaskGetTickCount();
 	while(1){
 	// Overall switch to change between normal and maintenance operations
 		xSemaphoreTake(systemStatusSemaphore, portMAX_DELAY);
@@ -462,7 +640,9 @@ void fsmControl_task(void *pvParameters){
 
 		};
 		xSemaphoreGive(systemStatusSemaphore);
-		vTaskDelay(5);
+		flushActuation(); // One write for whatever this step shed or reconnected
+		jobComplete(&taskTiming[FSM_TIMING], release);
+		vTaskDelayUntil(&release, fsmControl_task_T);
 
 	};
 
@@ -474,7 +654,25 @@ void fsmControl_task(void *pvParameters){
 // Receives incoming frequency data, calculates RoC and compares against thresholds
 void stabilityCheck_task(void *pvParamters){
 	double temp = 0;
+	TickType_t release = xTaskGetTickCount();
 	while(1){
+#ifdef PLANT_SIM
+		if(historyReset){ // Done here so no check ever sees a half reset history
+			int k;
+			while(xQueueReceive(raw_freq_data, &temp, 0) == pdTRUE); // Drop samples from the previous scenario
+			for(k = 0; k < 100; k++){
+				freq[k] = NOMINAL_FREQ;
+				dfreq[k] = 0;
+			}
+			i = 0;
+			currentFreq = NOMINAL_FREQ;
+			xSemaphoreTake(stableSemaphore, portMAX_DELAY);
+			stable = true;
+			PREVstable = true;
+			xSemaphoreGive(stableSemaphore);
+			historyReset = false;
+		}
+#endif
 		while(uxQueueMessagesWaiting( raw_freq_data ) != 0){
 			xQueueReceive( raw_freq_data, freq+i, 0 );
 			currentFreq = freq[i];
@@ -496,19 +694,21 @@ void stabilityCheck_task(void *pvParamters){
 //		printf("ROC : %d\n", abs((int)dfreq[i]));
 
 		// Comparing against thresholds to check stability of system
+		// i points at the oldest sample, so the newest RoC is the one before it
 		xSemaphoreTake(stableSemaphore, portMAX_DELAY);
-		if(thresholdRoc < abs(dfreq[i])||(thresholdFreq < currentFreq)){
+		if(thresholdRoc < fabs(dfreq[(i+99)%100])||(currentFreq < thresholdFreq)){
 			stable = false;
 		}else{
 			stable = true;
 		}
 
 		if(PREVstable != stable){
-			printf("RESETING 500 MS TIMER \n");
 			reset500Timer();
 		}
 		PREVstable = stable;
 		xSemaphoreGive(stableSemaphore);
+		jobComplete(&taskTiming[STABILITY_TIMING], release);
+		vTaskDelayUntil(&release, stabilityCheck_task_T); // Samples queue up between checks
 	}
 }
 
@@ -531,6 +731,7 @@ void buttonISR(void* context, alt_u32 id){
 		button_value = 1;
 		operationState = NORMAL;
 	}
+	requestActuationFromISR(); // Green LEDs depend on the operation state
 //	printf("Button value: %d", button_value);
 
 
@@ -540,12 +741,13 @@ void buttonISR(void* context, alt_u32 id){
 void keyboardISR(void* context, alt_u32 id){
 	char ascii;
 	int status = 0;
-	unsigned char key = 0;
+	KeyPress press;
 	KB_CODE_TYPE decode_mode;
-	status = decode_scancode (context, &decode_mode , &key , &ascii) ;
+	status = decode_scancode (context, &decode_mode , &press.key , &ascii) ;
 	if(keyboard_toggle == 3){ // Used as a sort of debounce, when a key is pressed it counts as 4, so this reduces that to 1
 		if ( status == 0 ){
-			xQueueSendFromISR(keyboardData, &key, pdFALSE);
+			press.pressed = xTaskGetTickCountFromISR(); // Release time for the keyboard task's response time
+			xQueueSendFromISR(keyboardData, &press, pdFALSE);
 			keyboard_toggle = 0;
 		}
 	}else{
@@ -557,9 +759,10 @@ void keyboardISR(void* context, alt_u32 id){
 
 // Receives keyboard data from queue and alters thresholds accordingly
 void keyboard_task(void *pvParameters){
-	unsigned char key;
+	KeyPress press;
 	while(1){
-		xQueueReceive(keyboardData, &key, portMAX_DELAY);
+		xQueueReceive(keyboardData, &press, portMAX_DELAY);
+		unsigned char key = press.key;
 		xSemaphoreTake(thresholdSemaphore, portMAX_DELAY);
 		if (key == 0x75) { // up arrow increment freq
 			thresholdFreq+= 1;
@@ -574,6 +777,7 @@ void keyboard_task(void *pvParameters){
 			thresholdRoc -= 1;
 		}
 		xSemaphoreGive(thresholdSemaphore);
+		jobComplete(&taskTiming[KEYBOARD_TIMING], press.pressed);
 
 	}
 }
@@ -588,64 +792,295 @@ void freq_relay(){
 	return;
 }
 
+#ifdef PLANT_SIM
+// Closed loop power system model used in place of the frequency analyser.
+// A single generator is modelled with the swing equation and a first order
+// governor, and the load demand follows the load_status mask set by the relay.
+// Everything is in per unit on the generator rating.
+#define PLANT_NOMINAL_FREQ NOMINAL_FREQ
+#define PLANT_PERIOD plantSim_task_T	// ms between model steps
+#define PLANT_RUN_TIME 20000		// ms each scenario runs for
+#define PLANT_EVENT_TIME 1000		// ms into the scenario the disturbance starts
+#define PLANT_RECOVER_BAND 1.0		// Hz from nominal counted as recovered, matches the default 49 Hz threshold
+#define PLANT_RECOVER_HOLD 1000		// ms the frequency must stay in band
+
+typedef struct{
+	double damping;			// D, load damping (pu power / pu freq)
+	double droop;			// R, governor droop (pu freq / pu power)
+	double govTime;			// Tg, governor time constant (s)
+	double baseDemand;		// Demand that the relay cannot shed
+	double loadDemand[5];	// Demand of each relay controlled load
+}PlantParams;
+
+typedef enum{
+	GEN_TRIP,		// Loses magnitude of generation at the event time
+	LOAD_STEP,		// Adds magnitude of unsheddable demand at the event time
+	OSCILLATION		// Demand swings by magnitude with the given period
+}ScenarioType;
+
+typedef struct{
+	const char *name;
+	ScenarioType type;
+	double magnitude;	// pu
+	double period;		// s, only used by OSCILLATION
+	double inertia;		// H, inertia constant of the grid (s)
+	int expectShed;		// Most loads the relay is expected to have shed at once
+	bool expectRecover;	// Whether the frequency is expected to settle back in band
+}Scenario;
+
+static const PlantParams plant = {1.0, 0.05, 0.5, 0.4, {0.12, 0.12, 0.12, 0.12, 0.12}};
+
+// Sized so each case exercises a different part of the relay with the default
+// 49 Hz and 60 Hz/s thresholds. The expected results are what the current
+// policy gives, so a changed policy or timing shows up as a mismatch.
+static const Scenario scenarios[] = {
+	{"Generator trip", GEN_TRIP, 0.5, 0, 5.0, 2, false},			// Under-frequency shedding, reconnecting too early keeps it hunting below 49 Hz
+	{"Load step", LOAD_STEP, 0.4, 0, 5.0, 1, true},				// Under-frequency shedding, settles just above 49 Hz
+	{"Low inertia load loss", LOAD_STEP, -0.3, 0, 0.1, 1, true},	// Over-frequency, so only the RoC test can trip
+	{"Oscillation", OSCILLATION, 0.15, 2.0, 5.0, 0, true}		// Relay must stay out
+};
+
+// Sums the demand of the loads currently connected by the relay
+double plantLoadDemand(){
+	double demand = plant.baseDemand;
+	int i;
+	xSemaphoreTake(loadStatusSemaphore, portMAX_DELAY);
+	for(i = 0; i < 5; i++){
+		if(load_status[i] == true){
+			demand += plant.loadDemand[i];
+		}
+	}
+	xSemaphoreGive(loadStatusSemaphore);
+	return demand;
+}
+
+// Counts the loads the relay has shed
+int plantLoadsShed(){
+	int shed = 0;
+	int i;
+	xSemaphoreTake(loadStatusSemaphore, portMAX_DELAY);
+	for(i = 0; i < 5; i++){
+		if(shed_status[i] == true){
+			shed++;
+		}
+	}
+	xSemaphoreGive(loadStatusSemaphore);
+	return shed;
+}
+
+// Reconnects every load and returns the relay to its default state between scenarios
+// stabilityCheck_task refills its frequency history with nominal samples first, so
+// the first second of a scenario is not judged on the RoC left over from the previous one
+void plantResetRelay(){
+	int i;
+	historyReset = true;
+	while(historyReset){
+		vTaskDelay(1);
+	}
+
+	xSemaphoreTake(systemStatusSemaphore, portMAX_DELAY);
+	xSemaphoreTake(loadStatusSemaphore, portMAX_DELAY);
+	for(i = 0; i < 5; i++){
+		load_status[i] = switch_status[i];
+		shed_status[i] = false;
+	}
+	allConnected = true;
+	currentState = DEFAULT;
+	timing = false;
+	timerFinished = false;
+	xSemaphoreGive(loadStatusSemaphore);
+	xSemaphoreGive(systemStatusSemaphore);
+	requestActuation();
+	flushActuation();
+}
+
+// Checks the relay has left the grid alone before the disturbance
+bool plantRelayIdle(){
+	xSemaphoreTake(systemStatusSemaphore, portMAX_DELAY);
+	bool idle = (currentState == DEFAULT);
+	xSemaphoreGive(systemStatusSemaphore);
+	return idle && (plantLoadsShed() == 0);
+}
+
+// Runs each scenario against the relay and reports how the grid recovered
+void plantSim_task(void *pvParameters){
+	const double dt = PLANT_PERIOD / 1000.0;
+	unsigned int s;
+	vTaskDelay(PLANT_EVENT_TIME); // Let the switches settle before the first scenario
+	for(s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++){
+		const Scenario *scenario = &scenarios[s];
+		plantResetRelay();
+
+		// Start at equilibrium with every load connected
+		double pRef = plantLoadDemand();
+		double pMech = pRef;
+		double deltaF = 0;
+		double cycles = 0;	// Grid cycles elapsed since the last analyser sample
+
+		double nadir = PLANT_NOMINAL_FREQ;
+		int maxShed = 0;
+		int recovered = -1;	// ms after the event the frequency settled, -1 if it never did
+		int inBandSince = -1;
+		bool valid = true;	// False if the relay acted before the disturbance
+		int t;
+		TickType_t wake = xTaskGetTickCount();
+
+		for(t = 0; t < PLANT_RUN_TIME; t += PLANT_PERIOD){
+			TickType_t release = wake;
+			double extra = 0;
+			if(t == PLANT_EVENT_TIME && scenario->type == GEN_TRIP){ // Tripped unit's output is lost instantly
+				pRef -= scenario->magnitude;
+				pMech -= scenario->magnitude;
+			}
+			if(t >= PLANT_EVENT_TIME){
+				if(scenario->type == LOAD_STEP){
+					extra = scenario->magnitude;
+				}else if(scenario->type == OSCILLATION){
+					extra = scenario->magnitude * sin(2.0 * M_PI * (t - PLANT_EVENT_TIME) / 1000.0 / scenario->period);
+				}
+			}
+
+			// Swing equation and governor response
+			double pLoad = plantLoadDemand() + extra;
+			deltaF += (pMech - pLoad - plant.damping * deltaF) / (2.0 * scenario->inertia) * dt;
+			pMech += (pRef - deltaF / plant.droop - pMech) / plant.govTime * dt;
+
+			// The analyser gives one count per grid cycle, and the RoC calculation in
+			// stabilityCheck_task relies on samples being one cycle apart
+			double f = PLANT_NOMINAL_FREQ * (1.0 + deltaF);
+			cycles += f * dt;
+			while(cycles >= 1.0){
+				cycles -= 1.0;
+				unsigned int count = (unsigned int)(SAMPLING_FREQ / f + 0.5); // What the analyser would have counted
+				double temp = SAMPLING_FREQ / (double)count;
+				xQueueSendToBack(raw_freq_data, &temp, 0);
+			}
+
+			// Scenario measurements
+			if(t < PLANT_EVENT_TIME && plantRelayIdle() == false){
+				valid = false;
+			}
+			if(t >= PLANT_EVENT_TIME){
+				if(f < nadir){
+					nadir = f;
+				}
+				int shed = plantLoadsShed();
+				if(shed > maxShed){
+					maxShed = shed;
+				}
+				if(fabs(f - PLANT_NOMINAL_FREQ) <= PLANT_RECOVER_BAND){
+					if(inBandSince < 0){
+						inBandSince = t;
+					}
+					if(recovered < 0 && t - inBandSince >= PLANT_RECOVER_HOLD){
+						recovered = inBandSince - PLANT_EVENT_TIME;
+					}
+				}else{
+					inBandSince = -1;
+					recovered = -1;
+				}
+			}
+
+			jobComplete(&taskTiming[PLANT_TIMING], release);
+			vTaskDelayUntil(&wake, PLANT_PERIOD);
+		}
+
+		if(valid){
+			bool expected = (maxShed == scenario->expectShed) && ((recovered >= 0) == scenario->expectRecover);
+			printf("%s: time to recover (ms): %d, nadir (Hz): %f, loads shed: %d (expected %d, %s) %s\n",
+					scenario->name, recovered, nadir, maxShed, scenario->expectShed,
+					scenario->expectRecover ? "recovers" : "does not recover", expected ? "OK" : "MISMATCH");
+		}else{
+			printf("%s: invalid, relay acted before the disturbance\n", scenario->name);
+		}
+	}
+	printf("Plant scenarios complete\n");
+	timingReport();
+	while(1){
+		vTaskDelay(portMAX_DELAY);
+	}
+}
+#endif
+
 // Green represents loads being switched off (load shedding)
 // Red represent loads that are switched on
 // In maintenance mode, no loads are shed
-void LEDcontroller_task(void *pvParameters){
+// Tasks only wake the actuator at the end of a job, so every change made in
+// that job, and any ISR change made before the actuator runs, is coalesced
+// into a single write of the packed output word
+void actuator_task(void *pvParameters){
+	int lastOutput = -1; // Forces the first commit
 	while(1){
+		xSemaphoreTake(actuateSemaphore, portMAX_DELAY);
+
+		taskENTER_CRITICAL();
+		unsigned int start = actuationStart;
+		actuationPending = false; // Changes after this point trigger another commit
+		taskEXIT_CRITICAL();
 
-		int finalred = 0;
-		int tmp;
-		int finalgreen = 0;
+		int output = 0; // Red in bits 0-4, green in bits 5-9
 		int i;
 		xSemaphoreTake(loadStatusSemaphore, portMAX_DELAY);
-		for ( i = 0; i < 5; i++) { // Convert load statuses array into a int to pass to LED functions
-			tmp = load_status[4-i];
-			finalred |= tmp << (5 - i - 1);
-		};
-
-		if (operationState != MAINTENANCE){ // No green if in maintenance
-			for ( i = 0; i < 5; i++) {
-				tmp = shed_status[4-i]; // Only show green if load was shed, turn off green if switch down
-				finalgreen |= tmp << (5 - i - 1);
-			};
-		}else{
-			finalgreen = 0;
+		for ( i = 0; i < 5; i++) {
+			output |= load_status[i] << i;
+			if (operationState != MAINTENANCE){ // No green if in maintenance
+				output |= shed_status[i] << (i + 5); // Only show green if load was shed, turn off green if switch down
+			}
 		}
 		xSemaphoreGive(loadStatusSemaphore);
-		IOWR_ALTERA_AVALON_PIO_DATA(RED_LEDS_BASE, finalred);
-		IOWR_ALTERA_AVALON_PIO_DATA(GREEN_LEDS_BASE, finalgreen);
 
-		vTaskDelay(5);
+		if(output != lastOutput){
+			IOWR_ALTERA_AVALON_PIO_DATA(RED_LEDS_BASE, output & 0x1f);
+			IOWR_ALTERA_AVALON_PIO_DATA(GREEN_LEDS_BASE, (output >> 5) & 0x1f);
+			lastOutput = output;
+		}
+		TickType_t committed = xTaskGetTickCount();
+
+		// Kept off measurementSemaphore so the display task can never hold up the actuator
+		actuationLatency = committed - start;
+		if(actuationLatency > actuationMax){
+			actuationMax = actuationLatency;
+		}
+		jobCompleteAt(&taskTiming[ACTUATOR_TIMING], start, committed);
 	}
 }
 
 
 // Task for polling the switches, sets switch statuses and load statuses
 void switchPolling_task(void *pvParameters){
+	TickType_t release = xTaskGetTickCount();
 	while(1){
+#ifdef PLANT_SIM
+		switch_value = 0x1f; // Every load is switched on while simulating
+#else
 		switch_value = IORD_ALTERA_AVALON_PIO_DATA(SLIDE_SWITCH_BASE);
+#endif
 		int i;
+		bool changed = false;
 		xSemaphoreTake(loadStatusSemaphore, portMAX_DELAY);
 		for (i = 0; i < 5; i++) { // update for first 5 switches (only 5 loads)
 			if (CHECK_BIT(switch_value, i)) {
 				switch_status[i] = true;
 				if((currentState == DEFAULT) || (operationState == MAINTENANCE)){ // Can only turn on loads in these states
+					changed |= (load_status[i] == false);
 					load_status[i] = true;
 					}
 				}
 			else {
 				switch_status[i] = false;
+				changed |= load_status[i] || shed_status[i];
 				load_status[i] = false;
 				shed_status[i] = false;
 			}
 		}
 		xSemaphoreGive(loadStatusSemaphore);
+		if(changed){ // Only wake the actuator when the outputs need to change
+			requestActuation();
+		}
+		flushActuation();
 
-
-
-
-		vTaskDelay(5);
+		jobComplete(&taskTiming[SWITCH_TIMING], release);
+		vTaskDelayUntil(&release, switchPolling_T);
 	}
 }
 
@@ -664,8 +1099,10 @@ int initOSDataStructs(void)
 	measurementSemaphore = xSemaphoreCreateMutex(); // mutex for various measurements displayed
 	systemStatusSemaphore = xSemaphoreCreateMutex();
 	stableSemaphore = xSemaphoreCreateMutex();
+	actuateSemaphore = xSemaphoreCreateBinary(); // signals the actuator that the load outputs changed
+	xSemaphoreGive(actuateSemaphore); // Commit the initial LED state on start up
 
-	keyboardData = xQueueCreate(100, sizeof(unsigned char));
+	keyboardData = xQueueCreate(100, sizeof(KeyPress));
 	raw_freq_data = xQueueCreate( 100, sizeof(double) );
 	timer500 = xTimerCreate("500ms timer", 500, pdTRUE, NULL, vTimer500Callback);
 
@@ -676,12 +1113,15 @@ int initOSDataStructs(void)
 // This function creates the tasks used in this example
 int initCreateTasks(void)
 {
-	xTaskCreate(LEDcontroller_task, "LEDcontroller_task", TASK_STACKSIZE, NULL, LEDcontroller_priority, NULL);
+	xTaskCreate(actuator_task, "actuator_task", TASK_STACKSIZE, NULL, actuator_task_P, NULL);
 	xTaskCreate(switchPolling_task, "switchPolling_task", TASK_STACKSIZE, NULL, switchPolling_priority, NULL);
-	xTaskCreate( PRVGADraw_Task, "DrawTsk", configMINIMAL_STACK_SIZE, NULL, PRVGADraw_Task_P, &PRVGADraw );
+	xTaskCreate( PRVGADraw_Task, "DrawTsk", TASK_STACKSIZE, NULL, PRVGADraw_Task_P, &PRVGADraw ); // Needs room for the timing report printf
 	xTaskCreate(keyboard_task, "keyboard_task", TASK_STACKSIZE, NULL, keyboard_task_P, NULL);
 	xTaskCreate(fsmControl_task, "fsmControl_task", TASK_STACKSIZE, NULL, fsmControl_task_P, NULL);
 	xTaskCreate(stabilityCheck_task, "stabilityCheck_task", TASK_STACKSIZE, NULL, stabilityCheck_task_P, NULL);
+#ifdef PLANT_SIM
+	xTaskCreate(plantSim_task, "plantSim_task", TASK_STACKSIZE, NULL, plantSim_task_P, NULL);
+#endif
 	return 0;
 }
 
@@ -705,7 +1145,9 @@ int initISRs(void){
     IOWR_8DIRECT(PS2_BASE,4,1);
 
     // SETUP FOR FREQUENCY RELAY ISR
+#ifndef PLANT_SIM // The plant simulation supplies the frequency samples instead
     alt_irq_register(FREQUENCY_ANALYSER_IRQ, 0, freq_relay);
+#endif
 
     return 0;
 